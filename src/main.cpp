@@ -2,8 +2,10 @@
 #include "servicetree.h"
 #include "ui.h"
 #include <fmt/format.h>
+#include <fmt/ranges.h>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -20,6 +22,11 @@ int main(int argc, char *argv[])
     argParse.add_description("And interactive systemd controller.\nhttps://github.com/ibensw/targetctl");
     argParse.add_argument("target").help("The systemd target to observe").default_value("-.slice");
     argParse.add_argument("-t", "--tree").help("Enable recursive scanning").flag();
+    argParse.add_argument("-m", "--match").help("Select units matching a glob pattern").default_value("*");
+    argParse.add_argument("-s", "--state").help("Select units in this state (active, failed, ...)");
+    argParse.add_argument("-x", "--exec")
+        .help("Run an action on the units selected by --match or --state and exit")
+        .choices("start", "stop", "restart", "reload");
 
     auto &typeGroup = argParse.add_mutually_exclusive_group();
     RelationType type{RelationType::RequiredBy};
@@ -41,19 +48,74 @@ int main(int argc, char *argv[])
     if (target.find('.') == target.npos) {
         target += ".target";
     }
+    if (argParse.is_used("--exec") && !argParse.is_used("--match") && !argParse.is_used("--state")) {
+        std::cerr << "--exec needs --match or --state to select units" << std::endl;
+        return 1;
+    }
+    ServiceTree::Filter filter{argParse.get<std::string>("--match")};
+    if (auto state = argParse.present("--state")) {
+        filter.state = parseActiveState(*state);
+        if (!filter.state) {
+            std::cerr << "Unknown state: " << *state << std::endl;
+            return 1;
+        }
+    }
+
     ServiceTree services(target, type, argParse.get<bool>("-t") ? 100 : 1);
     services.update();
 
+    if (auto action = argParse.present("--exec")) {
+        static const std::map<std::string, ServiceTree::batchFn> actions{
+            {"start", &ServiceTree::startAll},
+            {"stop", &ServiceTree::stopAll},
+            {"restart", &ServiceTree::restartAll},
+            {"reload", &ServiceTree::reloadAll},
+        };
+        // The observed unit itself is only acted on when it is named exactly
+        auto &root = services.getParent();
+        auto plan = services.plan(actions.at(*action), [&](const ServiceTree::Service &service) {
+            return (&service != &root || filter.pattern == root.name) && filter(service);
+        });
+        if (plan.waves.empty()) {
+            std::cerr << "No units matched" << std::endl;
+            return 1;
+        }
+        for (const auto &unit : plan.skipped) {
+            fmt::print("skip {} (restarted along with a dependency)\n", unit);
+        }
+        try {
+            services.bulkDo(plan, [&](const std::vector<std::string> &wave) {
+                fmt::print("{} {}\n", *action, fmt::join(wave, " "));
+            });
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
     TargetCtlUI ui(services);
+    if (argParse.is_used("--match") || argParse.is_used("--state")) {
+        ui.select(filter);
+    }
 
     Terminal terminal;
     std::atomic<bool> exited = false;
     Notifier stopSignal;
 
+    // Refreshes the service states every second, and follows a running bulk action more closely
     std::thread updater([&]() {
+        using namespace std::chrono;
+        steady_clock::time_point lastUpdate{};
         while (!exited) {
-            terminal.post([&](Terminal &, BaseElement) { services.update(); });
-            stopSignal.wait_for(std::chrono::milliseconds{1000});
+            if (steady_clock::now() - lastUpdate >= seconds{1}) {
+                lastUpdate = steady_clock::now();
+                terminal.post([&](Terminal &, BaseElement) { services.update(); });
+            }
+            if (ui.isBusy()) {
+                terminal.post([&](Terminal &, BaseElement) { ui.poll(); });
+            }
+            stopSignal.wait_for(milliseconds{ui.isBusy() ? 100 : 1000});
         }
     });
 
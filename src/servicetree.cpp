@@ -1,6 +1,8 @@
 #include "servicetree.h"
 #include <algorithm>
 #include <fmt/format.h>
+#include <fnmatch.h>
+#include <iterator>
 
 ServiceTree::Service ServiceTree::addService(std::set<std::string> &seen, std::string_view service,
                                              RelationType relation, std::size_t maxDepth, unsigned level)
@@ -10,6 +12,7 @@ ServiceTree::Service ServiceTree::addService(std::set<std::string> &seen, std::s
 
     auto childNames = getDependants(service, relation);
     std::sort(childNames.begin(), childNames.end());
+    edges[std::string(service)] = childNames;
     serviceObj.children.reserve(childNames.size());
     if (maxDepth > 0) {
         for (auto childName : childNames) {
@@ -23,7 +26,7 @@ ServiceTree::Service ServiceTree::addService(std::set<std::string> &seen, std::s
     return serviceObj;
 };
 
-ServiceTree::ServiceTree(std::string_view name, RelationType relation, std::size_t maxDepth)
+ServiceTree::ServiceTree(std::string_view name, RelationType relation, std::size_t maxDepth) : relation(relation)
 {
     std::set<std::string> seen;
     parent = addService(seen, name, relation, maxDepth);
@@ -41,6 +44,178 @@ bool ServiceTree::update()
             modified = true;
         }
     };
-    std::for_each(parent.children.begin(), parent.children.end(), updateService);
+    forEach(updateService);
     return modified;
 }
+
+bool ServiceTree::dependantsBelow() const
+{
+    return relation == RelationType::RequiredBy || relation == RelationType::WantedBy ||
+           relation == RelationType::ConsistsOf;
+}
+
+// Restarts propagate along Requires and PartOf, not along Wants
+bool ServiceTree::propagatesRestart() const
+{
+    return relation != RelationType::Wants && relation != RelationType::WantedBy;
+}
+
+namespace
+{
+using DependencyGraph = std::map<std::string, std::set<std::string>>;
+
+// Drops the units that systemd restarts along with another unit that is kept. Restarting a unit only try-restarts
+// the units that require it or are part of it, which does nothing for units that are not running. So a unit is only
+// dropped when it is running and so is every unit between it and a kept one. Units outside the tree have no known
+// state and stop the propagation as well. Units are visited in start order, so on a dependency cycle the first unit
+// is kept and the rest are dropped.
+std::set<std::string> withoutPropagatedRestarts(const std::vector<std::vector<std::string>> &startOrder,
+                                                const std::map<std::string, ActiveState> &states,
+                                                const DependencyGraph &graph)
+{
+    auto isRunning = [&states](const std::string &unit) {
+        auto state = states.find(unit);
+        return state != states.end() &&
+               (state->second == ActiveState::Active || state->second == ActiveState::Reloading ||
+                state->second == ActiveState::Activating);
+    };
+    auto pushDependants = [&graph](const std::string &unit, std::vector<std::string> &pending) {
+        auto dependants = graph.find(unit);
+        if (dependants != graph.end()) {
+            pending.insert(pending.end(), dependants->second.begin(), dependants->second.end());
+        }
+    };
+
+    std::set<std::string> kept;
+    std::set<std::string> reached;
+    for (const auto &wave : startOrder) {
+        for (const auto &name : wave) {
+            if (reached.count(name) > 0) {
+                continue;
+            }
+            kept.insert(name);
+            std::vector<std::string> pending;
+            pushDependants(name, pending);
+            while (!pending.empty()) {
+                auto unit = pending.back();
+                pending.pop_back();
+                if (isRunning(unit) && reached.insert(unit).second) {
+                    pushDependants(unit, pending);
+                }
+            }
+        }
+    }
+    return kept;
+}
+
+// Levels are the longest dependency path to each unit (Kahn's algorithm). They are computed over the whole graph, so
+// ordering through units that are not in names is kept. Units on a dependency cycle go in a final wave.
+std::vector<std::vector<std::string>> orderWaves(const std::set<std::string> &names, bool shutdown,
+                                                 const DependencyGraph &graph)
+{
+    std::map<std::string, unsigned> inDegree;
+    for (const auto &[unit, dependants] : graph) {
+        inDegree.try_emplace(unit, 0);
+        for (const auto &dependant : dependants) {
+            inDegree[dependant]++;
+        }
+    }
+
+    std::map<std::string, unsigned> level;
+    std::vector<std::string> ready;
+    for (const auto &[unit, degree] : inDegree) {
+        if (degree == 0) {
+            ready.push_back(unit);
+        }
+    }
+    unsigned maxLevel = 0;
+    while (!ready.empty()) {
+        auto unit = ready.back();
+        ready.pop_back();
+        auto unitLevel = level[unit];
+        maxLevel = std::max(maxLevel, unitLevel);
+        auto dependants = graph.find(unit);
+        if (dependants == graph.end()) {
+            continue;
+        }
+        for (const auto &dependant : dependants->second) {
+            level[dependant] = std::max(level[dependant], unitLevel + 1);
+            if (--inDegree[dependant] == 0) {
+                ready.push_back(dependant);
+            }
+        }
+    }
+
+    std::vector<std::vector<std::string>> result(maxLevel + 2);
+    for (const auto &name : names) {
+        auto degree = inDegree.find(name);
+        bool cyclic = degree != inDegree.end() && degree->second > 0;
+        result[cyclic ? maxLevel + 1 : level[name]].push_back(name);
+    }
+    std::erase_if(result, [](const auto &wave) { return wave.empty(); });
+    if (shutdown) {
+        std::reverse(result.begin(), result.end());
+    }
+    return result;
+}
+} // namespace
+
+// Maps every unit to the units that depend on it
+std::map<std::string, std::set<std::string>> ServiceTree::dependencyGraph() const
+{
+    std::map<std::string, std::set<std::string>> graph;
+    bool below = dependantsBelow();
+    for (const auto &[unit, related] : edges) {
+        for (const auto &other : related) {
+            if (below) {
+                graph[unit].insert(other);
+            } else {
+                graph[other].insert(unit);
+            }
+        }
+    }
+    return graph;
+}
+
+ServiceTree::Plan ServiceTree::makePlan(batchFn action, const std::set<std::string> &names)
+{
+    auto graph = dependencyGraph();
+    Plan plan{action, {}, {}};
+    auto kept = names;
+    if (action == &SystemCtl::restartAll && propagatesRestart()) {
+        std::map<std::string, ActiveState> states;
+        forEach([&states](Service &service) { states.emplace(service.name, service.state); });
+        kept = withoutPropagatedRestarts(orderWaves(names, false, graph), states, graph);
+        std::set_difference(names.begin(), names.end(), kept.begin(), kept.end(), std::back_inserter(plan.skipped));
+    }
+    plan.waves = orderWaves(kept, action == &SystemCtl::stopAll, graph);
+    return plan;
+}
+
+void ServiceTree::bulkDo(const Plan &plan, const waveFn &onWave)
+{
+    for (const auto &wave : plan.waves) {
+        if (onWave) {
+            onWave(wave);
+        }
+        auto batch = (this->*plan.action)(wave);
+        wait(*batch);
+    }
+}
+
+std::size_t ServiceTree::Plan::unitCount() const
+{
+    std::size_t count = 0;
+    for (const auto &wave : waves) {
+        count += wave.size();
+    }
+    return count;
+}
+
+bool ServiceTree::Filter::operator()(const Service &service) const
+{
+    if (state && service.state != *state) {
+        return false;
+    }
+    return fnmatch(pattern.c_str(), service.name.c_str(), 0) == 0;
+}
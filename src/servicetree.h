@@ -2,7 +2,10 @@
 
 #include "systemctl.h"
 #include <chrono>
+#include <functional>
 #include <limits>
+#include <map>
+#include <optional>
 #include <set>
 #include <string>
 #include <string_view>
@@ -19,6 +22,16 @@ class ServiceTree : public SystemCtl
         std::vector<Service> children;
     };
 
+    // Matches services by glob pattern on the unit name and, optionally, by state
+    struct Filter {
+        std::string pattern{"*"};
+        std::optional<ActiveState> state{};
+        bool operator()(const Service &service) const;
+    };
+
+    using batchFn = std::unique_ptr<JobBatch> (SystemCtl::*)(const std::vector<std::string> &);
+    using waveFn = std::function<void(const std::vector<std::string> &)>;
+
     ServiceTree(std::string_view name, RelationType relation = RelationType::RequiredBy,
                 std::size_t maxDepth = std::numeric_limits<std::size_t>::max());
     ~ServiceTree() = default;
@@ -28,7 +41,39 @@ class ServiceTree : public SystemCtl
 
     template <typename T> void forEach(T callback) { forEachImpl(callback, parent); }
 
+    // The units a bulk action runs on, grouped into waves. Waves are ordered so that a unit comes after every unit
+    // it depends on, or before them when stopping. All units in a wave are sent to systemd together.
+    struct Plan {
+        batchFn action;
+        std::vector<std::vector<std::string>> waves;
+        // Running units left out of a restart, because systemd restarts them along with a unit they depend on
+        std::vector<std::string> skipped;
+        [[nodiscard]] std::size_t unitCount() const;
+    };
+
+    // Plan action for all services matching predicate. Restarting a unit makes systemd also restart the running
+    // units that require it or are part of it. Those are skipped when a unit they depend on is restarted too, so
+    // they are not restarted twice. Units that are not running are always kept.
+    template <typename T> Plan plan(batchFn action, T predicate)
+    {
+        std::set<std::string> names;
+        forEach([&](Service &service) {
+            if (predicate(service)) {
+                names.insert(service.name);
+            }
+        });
+        return makePlan(action, names);
+    }
+
+    // Run a plan one wave at a time, calling onWave before each wave. Blocks until the jobs of each wave have
+    // finished before starting the next one, and stops at the first wave that fails.
+    void bulkDo(const Plan &plan, const waveFn &onWave = {});
+
   private:
+    [[nodiscard]] bool dependantsBelow() const;
+    [[nodiscard]] bool propagatesRestart() const;
+    [[nodiscard]] std::map<std::string, std::set<std::string>> dependencyGraph() const;
+    Plan makePlan(batchFn action, const std::set<std::string> &names);
     Service addService(std::set<std::string> &seen, std::string_view service, RelationType relation,
                        std::size_t maxDepth, unsigned level = 0);
     template <typename T> void forEachImpl(T callback, Service &service)
@@ -40,4 +85,7 @@ class ServiceTree : public SystemCtl
     }
 
     Service parent;
+    RelationType relation;
+    // Every relation seen while building the tree, including the ones to units already placed elsewhere
+    std::map<std::string, std::vector<std::string>> edges;
 };
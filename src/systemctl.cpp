@@ -2,6 +2,10 @@
 #include "msgreader.h"
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
 #include <stdexcept>
 #include <utility>
 
@@ -43,10 +47,170 @@ void SystemCtl::doAction(std::string_view name, const char *action)
     }
 }
 
+JobBatch::JobBatch(sd_bus *bus) : bus(bus)
+{
+    DBusMessage reply;
+    auto ret = sd_bus_call_method(bus, SERVICE_NAME, OBJECT_PATH, INTERFACE_MANAGER, "Subscribe", &reply.err(),
+                                  &reply.msg(), "");
+    if (ret < 0 && !sd_bus_error_has_name(&reply.err(), "org.freedesktop.systemd1.AlreadySubscribed")) {
+        throw std::runtime_error(reply.err().message);
+    }
+}
+
+JobBatch::~JobBatch()
+{
+    std::for_each(slots.begin(), slots.end(), sd_bus_slot_unref);
+    sd_bus_call_method(bus, SERVICE_NAME, OBJECT_PATH, INTERFACE_MANAGER, "Unsubscribe", nullptr, nullptr, "");
+}
+
+bool JobBatch::finished() const
+{
+    return std::all_of(jobs.cbegin(), jobs.cend(), [this](const auto &job) {
+        return job.replied && (job.path.empty() || removed.count(job.path) > 0);
+    });
+}
+
+std::string JobBatch::error() const
+{
+    auto errors = failures;
+    for (const auto &job : jobs) {
+        auto result = job.path.empty() ? removed.end() : removed.find(job.path);
+        if (result != removed.end() && result->second != "done") {
+            errors.push_back(job.unit + ": job " + result->second);
+        }
+    }
+    std::string message;
+    for (const auto &error : errors) {
+        message += (message.empty() ? "" : ", ") + error;
+    }
+    return message;
+}
+
+// Replies only mean the job was queued, they carry the job path to wait for
+int JobBatch::onReply(sd_bus_message *reply, void *userdata, sd_bus_error * /*retError*/)
+{
+    auto &job = *static_cast<Job *>(userdata);
+    job.replied = true;
+    const auto *error = sd_bus_message_get_error(reply);
+    if (error != nullptr) {
+        job.owner->failures.push_back(job.unit + ": " + error->message);
+        return 0;
+    }
+    const char *path = nullptr;
+    if (sd_bus_message_read(reply, "o", &path) < 0) {
+        job.owner->failures.push_back(job.unit + ": failed to read reply");
+        return 0;
+    }
+    job.path = path;
+    return 0;
+}
+
+int JobBatch::onJobRemoved(sd_bus_message *message, void *userdata, sd_bus_error * /*retError*/)
+{
+    auto &batch = *static_cast<JobBatch *>(userdata);
+    uint32_t id = 0;
+    const char *path = nullptr;
+    const char *unit = nullptr;
+    const char *result = nullptr;
+    if (sd_bus_message_read(message, "uoss", &id, &path, &unit, &result) < 0) {
+        return 0;
+    }
+    // Only keep the jobs of our own units, the batch may be followed for a long time
+    if (std::any_of(batch.jobs.cbegin(), batch.jobs.cend(), [unit](const auto &job) { return job.unit == unit; })) {
+        batch.removed.emplace(path, result);
+    }
+    return 0;
+}
+
+std::unique_ptr<JobBatch> SystemCtl::doActions(const std::vector<std::string> &names, const char *action)
+{
+    std::unique_ptr<JobBatch> batch(new JobBatch(bus));
+
+    // Watch for finished jobs before queueing any, so none of their JobRemoved signals can be missed
+    sd_bus_slot *slot = nullptr;
+    auto ret = sd_bus_match_signal(bus, &slot, SERVICE_NAME, OBJECT_PATH, INTERFACE_MANAGER, "JobRemoved",
+                                   JobBatch::onJobRemoved, batch.get());
+    if (ret < 0) {
+        throw std::runtime_error(strerror(-ret));
+    }
+    batch->slots.push_back(slot);
+
+    for (const auto &name : names) {
+        auto &job = batch->jobs.emplace_back(JobBatch::Job{batch.get(), name, {}, false});
+        ret = sd_bus_call_method_async(bus, &slot, SERVICE_NAME, OBJECT_PATH, INTERFACE_MANAGER, action,
+                                       JobBatch::onReply, &job, "ss", name.c_str(), "replace");
+        if (ret < 0) {
+            throw std::runtime_error(name + ": " + strerror(-ret));
+        }
+        batch->slots.push_back(slot);
+    }
+    return batch;
+}
+
+bool SystemCtl::poll(JobBatch &batch)
+{
+    int ret = 0;
+    while ((ret = sd_bus_process(bus, nullptr)) > 0) {
+    }
+    if (ret < 0) {
+        throw std::runtime_error(strerror(-ret));
+    }
+    return batch.finished();
+}
+
+void SystemCtl::wait(JobBatch &batch)
+{
+    while (!poll(batch)) {
+        auto ret = sd_bus_wait(bus, std::numeric_limits<uint64_t>::max());
+        if (ret < 0) {
+            throw std::runtime_error(strerror(-ret));
+        }
+    }
+    auto error = batch.error();
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
 void SystemCtl::start(std::string_view name) { doAction(name, Methods::START); }
 void SystemCtl::stop(std::string_view name) { doAction(name, Methods::STOP); }
 void SystemCtl::restart(std::string_view name) { doAction(name, Methods::RESTART); }
 void SystemCtl::reload(std::string_view name) { doAction(name, Methods::RELOAD); }
+std::unique_ptr<JobBatch> SystemCtl::startAll(const std::vector<std::string> &names)
+{
+    return doActions(names, Methods::START);
+}
+std::unique_ptr<JobBatch> SystemCtl::stopAll(const std::vector<std::string> &names)
+{
+    return doActions(names, Methods::STOP);
+}
+std::unique_ptr<JobBatch> SystemCtl::restartAll(const std::vector<std::string> &names)
+{
+    return doActions(names, Methods::RESTART);
+}
+std::unique_ptr<JobBatch> SystemCtl::reloadAll(const std::vector<std::string> &names)
+{
+    return doActions(names, Methods::RELOAD);
+}
+
+std::optional<ActiveState> parseActiveState(std::string_view state)
+{
+    static constexpr const std::array<std::pair<std::string_view, ActiveState>, 6> stateMap{{
+        {"active", ActiveState::Active},
+        {"reloading", ActiveState::Reloading},
+        {"inactive", ActiveState::Inactive},
+        {"failed", ActiveState::Failed},
+        {"activating", ActiveState::Activating},
+        {"deactivating", ActiveState::Deactivating},
+    }};
+
+    auto found =
+        std::find_if(stateMap.cbegin(), stateMap.cend(), [&](const auto &entry) { return entry.first == state; });
+    if (found == stateMap.cend()) {
+        return std::nullopt;
+    }
+    return found->second;
+}
 
 std::string SystemCtl::getUnitObjectPath(std::string_view name)
 {
@@ -98,18 +262,8 @@ ActiveState SystemCtl::getStatus(std::string_view name)
         throw std::runtime_error(strerror(-ret));
     }
 
-    static constexpr const std::array<std::pair<std::string_view, ActiveState>, 6> stateMap{{
-        {"active", ActiveState::Active},
-        {"reloading", ActiveState::Reloading},
-        {"inactive", ActiveState::Inactive},
-        {"failed", ActiveState::Failed},
-        {"activating", ActiveState::Activating},
-        {"deactivating", ActiveState::Deactivating},
-    }};
-
     auto state = *DBusMessageReader<std::string>::read(reply); // NOLINT(bugprone-unchecked-optional-access)
-    return std::find_if(stateMap.cbegin(), stateMap.cend(), [&](const auto &entry) { return entry.first == state; })
-        ->second;
+    return *parseActiveState(state); // NOLINT(bugprone-unchecked-optional-access)
 }
 
 std::chrono::steady_clock::time_point SystemCtl::getStateChange(std::string_view name)
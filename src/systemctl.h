@@ -1,7 +1,10 @@
 #pragma once
 
 #include <chrono>
+#include <deque>
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <systemd/sd-bus.h>
@@ -38,6 +41,8 @@ enum class ActiveState {
     Deactivating,
 };
 
+std::optional<ActiveState> parseActiveState(std::string_view state);
+
 enum class RelationType {
     RequiredBy,
     Requires,
@@ -47,6 +52,38 @@ enum class RelationType {
     PartOf,
 };
 
+// The jobs queued by one batch call, tracked through the manager's JobRemoved signal until all have finished
+class JobBatch
+{
+  public:
+    JobBatch(const JobBatch &) = delete;
+    JobBatch &operator=(const JobBatch &) = delete;
+    ~JobBatch();
+
+    [[nodiscard]] bool finished() const;
+    // One message per unit whose job could not be queued or did not finish successfully, empty if all went well
+    [[nodiscard]] std::string error() const;
+
+  private:
+    friend class SystemCtl;
+    struct Job {
+        JobBatch *owner;
+        std::string unit;
+        std::string path;
+        bool replied = false;
+    };
+
+    explicit JobBatch(sd_bus *bus);
+    static int onReply(sd_bus_message *reply, void *userdata, sd_bus_error *retError);
+    static int onJobRemoved(sd_bus_message *message, void *userdata, sd_bus_error *retError);
+
+    sd_bus *bus;
+    std::deque<Job> jobs;
+    std::map<std::string, std::string> removed; // job path -> result
+    std::vector<std::string> failures;
+    std::vector<sd_bus_slot *> slots;
+};
+
 class SystemCtl
 {
   public:
@@ -57,12 +94,22 @@ class SystemCtl
     void stop(std::string_view name);
     void restart(std::string_view name);
     void reload(std::string_view name);
+    // Batch variants: all jobs are queued at once and the calls return without waiting for them
+    std::unique_ptr<JobBatch> startAll(const std::vector<std::string> &names);
+    std::unique_ptr<JobBatch> stopAll(const std::vector<std::string> &names);
+    std::unique_ptr<JobBatch> restartAll(const std::vector<std::string> &names);
+    std::unique_ptr<JobBatch> reloadAll(const std::vector<std::string> &names);
+    // Blocks until every job in batch has finished, throws with batch.error() if any of them failed
+    void wait(JobBatch &batch);
+    // Handles the messages that already arrived without blocking, returns whether every job in batch has finished
+    bool poll(JobBatch &batch);
     ActiveState getStatus(std::string_view name);
     std::chrono::steady_clock::time_point getStateChange(std::string_view name);
     std::vector<std::string> getDependants(std::string_view name, RelationType relation);
 
   private:
     void doAction(std::string_view name, const char *action);
+    std::unique_ptr<JobBatch> doActions(const std::vector<std::string> &names, const char *action);
     std::string getUnitObjectPath(std::string_view name);
     std::vector<std::string> readA(std::string_view name, std::string_view property);
     sd_bus *bus = nullptr;
@@ -1,9 +1,12 @@
 #include "ui.h"
 
+#include <algorithm>
 #include <chrono>
 #include <fmt/core.h>
 #include <fmt/format.h>
+#include <fmt/ranges.h>
 #include <tuilight/terminal.h>
+#include <unordered_set>
 
 using namespace wibens::tuilight;
 
@@ -25,8 +28,10 @@ Color stateColor(ActiveState state)
     return Color::Black;
 }
 
-ServiceEntry::ServiceEntry(ServiceTree::Service *pservice, unsigned *selCount)
-    : HContainer({}), service(*pservice), selCount(selCount), selectedText("[ ]"), stateTime("")
+ServiceEntry::ServiceEntry(ServiceTree::Service *pservice, unsigned *selCount,
+                           std::function<void(ServiceEntry &)> onSubtree)
+    : HContainer({}), service(*pservice), selCount(selCount), onSubtree(std::move(onSubtree)), selectedText("[ ]"),
+      stateTime("")
 {
     elements.push_back(selectedText);
     std::string indent(service.depth * 2 + 1, ' ');
@@ -41,6 +46,10 @@ bool ServiceEntry::handleEvent(KeyEvent event)
         *selCount = *selCount + (selected ? +1 : -1);
         return true;
     }
+    if (event == ansi::CharEvent('s')) {
+        onSubtree(*this);
+        return true;
+    }
     return false;
 }
 
@@ -85,8 +94,10 @@ void ServiceEntry::render(View &view)
 TargetCtlUI::TargetCtlUI(ServiceTree &stree) : services(stree)
 {
     // Make the service list
-    services.forEach(
-        [this](ServiceTree::Service &service) { serviceMenuEntries.emplace_back(&service, &selectionCount); });
+    services.forEach([this](ServiceTree::Service &service) {
+        serviceMenuEntries.emplace_back(&service, &selectionCount,
+                                        [this](ServiceEntry &entry) { selectSubtree(entry); });
+    });
     std::vector<BaseElement> baseServices(serviceMenuEntries.begin(), serviceMenuEntries.end());
     auto serviceMenu = VMenu(baseServices);
 
@@ -121,10 +132,11 @@ TargetCtlUI::TargetCtlUI(ServiceTree &stree) : services(stree)
                    statusActiveText | ForegroundColor(Color::Green));
 
     auto actionBar = HContainer(Button("Select All", [this] { selectAllNone(); }),
-                                Button("Start", [this] { selectedDo(&ServiceTree::start); }),
-                                Button("Stop", [this] { selectedDo(&ServiceTree::stop); }),
-                                Button("Restart", [this] { selectedDo(&ServiceTree::restart); }),
-                                Button("Reload", [this] { selectedDo(&ServiceTree::reload); }) | Stretch(), statusBar);
+                                Button("Start", [this] { selectedDo(&ServiceTree::startAll); }),
+                                Button("Stop", [this] { selectedDo(&ServiceTree::stopAll); }),
+                                Button("Restart", [this] { selectedDo(&ServiceTree::restartAll); }),
+                                Button("Reload", [this] { selectedDo(&ServiceTree::reloadAll); }),
+                                Button("Cancel", [this] { cancel(); }) | Stretch(), statusBar);
 
     ui = VContainer(serviceMenu | Fit, actionBar) | PreRender(fillStatusBar);
 }
@@ -137,14 +149,119 @@ void TargetCtlUI::selectAllNone()
     selectionCount = select ? serviceMenuEntries.size() : 0;
 }
 
-void TargetCtlUI::selectedDo(actionFn action)
+void TargetCtlUI::select(const ServiceTree::Filter &filter)
+{
+    selectionCount = 0;
+    std::for_each(serviceMenuEntries.begin(), serviceMenuEntries.end(), [this, &filter](auto &entry) {
+        entry->selected = filter(entry->service);
+        selectionCount += entry->selected ? 1 : 0;
+    });
+}
+
+// Toggle the selection of a service and everything below it. Entries are stored in tree order, so the subtree is
+// the run of entries directly following root that are nested deeper than it.
+void TargetCtlUI::selectSubtree(ServiceEntry &root)
+{
+    auto first = std::find_if(serviceMenuEntries.begin(), serviceMenuEntries.end(),
+                              [&root](const auto &entry) { return &entry->service == &root.service; });
+    if (first == serviceMenuEntries.end()) {
+        return;
+    }
+    auto last = std::find_if(std::next(first), serviceMenuEntries.end(),
+                             [&root](const auto &entry) { return entry->service.depth <= root.service.depth; });
+    bool select = !root.selected;
+    std::for_each(first, last, [this, select](auto &entry) {
+        if (entry->selected != select) {
+            entry->selected = select;
+            selectionCount = selectionCount + (select ? +1 : -1);
+        }
+    });
+}
+
+void TargetCtlUI::selectedDo(ServiceTree::batchFn action)
 {
     if (selectionCount == 0) {
         setStatus("Nothing selected");
+        return;
+    }
+    if (bulkPlan) {
+        setStatus("Still busy, cancel first");
+        return;
     }
-    std::for_each(serviceMenuEntries.cbegin(), serviceMenuEntries.cend(), [this, action](const auto &entry) {
+    std::unordered_set<const ServiceTree::Service *> selected;
+    std::for_each(serviceMenuEntries.cbegin(), serviceMenuEntries.cend(), [&selected](const auto &entry) {
         if (entry->selected) {
-            (services.*action)(entry->service.name);
+            selected.insert(&entry->service);
         }
     });
+    bulkPlan = services.plan(action, [&selected](const ServiceTree::Service &service) {
+        return selected.count(&service) > 0;
+    });
+    if (bulkPlan->waves.empty()) {
+        finishBulk("Nothing to do");
+        return;
+    }
+    bulkWave = 0;
+    busy = true;
+    startWave();
+}
+
+// Queue the jobs of the current wave, poll() moves on to the next one once they have all finished
+void TargetCtlUI::startWave()
+{
+    try {
+        const auto &wave = bulkPlan->waves[bulkWave];
+        bulkBatch = (services.*bulkPlan->action)(wave);
+        setStatus(fmt::format("Wave {}/{}: {}", bulkWave + 1, bulkPlan->waves.size(), fmt::join(wave, " ")));
+    } catch (const std::runtime_error &e) {
+        finishBulk(e.what());
+    }
+}
+
+void TargetCtlUI::poll()
+{
+    if (!bulkPlan) {
+        return;
+    }
+    try {
+        if (!services.poll(*bulkBatch)) {
+            return;
+        }
+    } catch (const std::runtime_error &e) {
+        finishBulk(e.what());
+        return;
+    }
+    auto error = bulkBatch->error();
+    if (!error.empty()) {
+        finishBulk(error);
+        return;
+    }
+    if (++bulkWave < bulkPlan->waves.size()) {
+        startWave();
+        return;
+    }
+    auto message = fmt::format("Finished {} units in {} waves", bulkPlan->unitCount(), bulkPlan->waves.size());
+    if (!bulkPlan->skipped.empty()) {
+        message += fmt::format(", {} restarted along with a dependency", bulkPlan->skipped.size());
+    }
+    finishBulk(message);
+}
+
+// Jobs already queued keep running in systemd, only the waves that were not started yet are dropped
+void TargetCtlUI::cancel()
+{
+    if (!bulkPlan) {
+        setStatus("Nothing to cancel");
+        return;
+    }
+    finishBulk(fmt::format("Cancelled, {} of {} waves not started", bulkPlan->waves.size() - bulkWave - 1,
+                           bulkPlan->waves.size()));
+}
+
+void TargetCtlUI::finishBulk(const std::string &message)
+{
+    bulkBatch.reset();
+    bulkPlan.reset();
+    busy = false;
+    setStatus(message);
 }
@@ -2,14 +2,17 @@
 
 #include "journal.h"
 #include "servicetree.h"
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <string>
 #include <tuilight/terminal.h>
 #include <vector>
 
 struct ServiceEntry : wibens::tuilight::detail::HContainer {
-    ServiceEntry(ServiceTree::Service *pservice, unsigned *selCount);
+    ServiceEntry(ServiceTree::Service *pservice, unsigned *selCount, std::function<void(ServiceEntry &)> onSubtree);
     bool handleEvent(wibens::tuilight::KeyEvent event) override;
     void setFocus(bool focus) override { wibens::tuilight::BaseElementImpl::setFocus(focus); };
     [[nodiscard]] bool focusable() const override { return true; }
@@ -18,6 +21,7 @@ struct ServiceEntry : wibens::tuilight::detail::HContainer {
 
     ServiceTree::Service &service;
     unsigned *selCount;
+    std::function<void(ServiceEntry &)> onSubtree;
     wibens::tuilight::Element<wibens::tuilight::detail::Text> selectedText;
     wibens::tuilight::Element<wibens::tuilight::detail::Text> stateTime;
     bool selected = false;
@@ -33,15 +37,27 @@ class TargetCtlUI
     operator wibens::tuilight::BaseElement() const { return ui; };
 
     inline void setStatus(const std::string &message) { statusMessage->text = message + " | "; }
+    void select(const ServiceTree::Filter &filter);
+    // Advances a running bulk action, to be called regularly from the event loop
+    void poll();
+    // Whether a bulk action is running, safe to read from other threads
+    [[nodiscard]] bool isBusy() const { return busy; }
 
   private:
     void selectAllNone();
-    using actionFn = void (ServiceTree::*)(std::string_view);
-    void selectedDo(actionFn action);
+    void selectSubtree(ServiceEntry &root);
+    void selectedDo(ServiceTree::batchFn action);
+    void startWave();
+    void cancel();
+    void finishBulk(const std::string &message);
 
     ServiceTree &services;
     wibens::tuilight::Element<wibens::tuilight::detail::Text> statusMessage{""};
     wibens::tuilight::BaseElement ui{};
     std::vector<wibens::tuilight::Element<ServiceEntry>> serviceMenuEntries;
     unsigned selectionCount{};
+    std::optional<ServiceTree::Plan> bulkPlan;
+    std::size_t bulkWave{};
+    std::unique_ptr<JobBatch> bulkBatch;
+    std::atomic<bool> busy{false};
 };